@@ -8,8 +8,12 @@
 #include <eosio/eosio.hpp>
 #include <eosio/singleton.hpp>
 #include <eosio/binary_extension.hpp>
+#include <eosio/crypto.hpp>
+#include <eosio/ignore.hpp>
 
+#include <map>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace eosiosystem {
@@ -24,6 +28,7 @@ namespace eosio {
    class [[eosio::contract("cyber.token")]] token : public contract {
       public:
          using contract::contract;
+         ~token();
 
          [[eosio::action]]
          void create( name   issuer,
@@ -48,7 +53,20 @@ namespace eosio {
          };
 
          [[eosio::action]]
-         void bulktransfer( name from, vector<recipient> recipients );
+         void bulktransfer( ignore<name> from, ignore<vector<recipient>> recipients );
+
+         /**
+            \brief The \ref bulkissue action issues tokens directly to several recipients.
+
+            \param recipients list of recipients; each entry has a recipient, quantity and memo. All quantities must have the same symbol
+
+            The token issuer calls this action to issue tokens to many accounts at once (e.g. for an airdrop). The supply is checked against the maximum supply and updated once for the total amount, then every distinct recipient is credited directly, without crediting the issuer and sending inline transfers as \ref issue does. The issuer and every distinct recipient are notified once.
+
+            \signreq
+                  — the token issuer account.
+         */
+         [[eosio::action]]
+         void bulkissue( ignore<vector<recipient>> recipients );
 
          [[eosio::action]]
          void payment( name    from,
@@ -57,17 +75,220 @@ namespace eosio {
                        string  memo );
 
          [[eosio::action]]
-         void bulkpayment( name from, vector<recipient> recipients );
+         void bulkpayment( ignore<name> from, ignore<vector<recipient>> recipients );
+
+         /**
+            \brief The \ref bulkmulti action transfers tokens of different symbols to several recipients.
+
+            \param from account name of tokens sender
+            \param recipients list of transfers; each entry has a recipient, quantity and memo. Quantities may have different symbols
+
+            The sender calls this action to send a batch of transfers in several tokens at once. Recipients are grouped by token symbol: each group is checked against its token stats once, the sender balance of each token is debited once for the group total, and every distinct recipient is credited once per token. Each distinct recipient is notified once.
+
+            \signreq
+                  — the \a from account.
+         */
+         [[eosio::action]]
+         void bulkmulti( ignore<name> from, ignore<vector<recipient>> recipients );
+
+         /**
+            \brief The \ref bulkmultipay action makes payments in tokens of different symbols to several recipients.
+
+            \param from account name of tokens sender
+            \param recipients list of payments; each entry has a recipient, quantity and memo. Quantities may have different symbols
+
+            Works like \ref bulkmulti, but the tokens are credited to recipients payments (to be claimed with \ref claim) and recipients are not notified.
+
+            \signreq
+                  — the \a from account.
+         */
+         [[eosio::action]]
+         void bulkmultipay( ignore<name> from, ignore<vector<recipient>> recipients );
+
+         struct transfer_leg {
+             name    from;
+             name    to;
+             asset   quantity;
+         };
+
+         /**
+            \brief The \ref settle action settles a list of transfers by their net result.
+
+            \param legs list of transfers; each entry has a sender, a recipient and a quantity. Quantities may have different symbols
+
+            The action computes the net change of every balance over all \a legs and applies only the net changes: one debit for each account whose net position is negative and one credit for each account whose net position is positive. Overdraft, safe and global lock checks apply to the net debits. Every sender and recipient is notified once. A new balance object is paid by the recipient if he signed the action, otherwise by the sender of a transfer to it who signed the action; the action fails if there is no such account.
+
+            \signreq
+                  — every account whose net position in some token is negative.
+         */
+         [[eosio::action]]
+         void settle( vector<transfer_leg> legs );
 
          [[eosio::action]]
          void claim(name owner , asset quantity);
 
+         /**
+            \brief The \ref setdrop action publishes an airdrop as a merkle root.
+
+            \param id identifier of the airdrop; must be unique
+            \param total total amount of the airdrop. It must be positive, have correct token symbol and not exceed available supply
+            \param root merkle root of the airdrop leaves. A leaf is sha256 of packed (index, account, quantity), where index is the leaf position (from 0); an inner node is sha256 of two concatenated child hashes
+
+            The token issuer calls this action to distribute tokens without creating balances up front. The \a total is issued at once to the balance of the token contract account, which holds it until recipients claim their tokens with \ref claimdrop; unclaimed tokens are retired by \ref closedrop.
+
+            \signreq
+                  — the token issuer account.
+         */
+         [[eosio::action]]
+         void setdrop(name id, asset total, checksum256 root);
+
+         /**
+            \brief The \ref claimdrop action claims tokens from an airdrop.
+
+            \param id identifier of the airdrop
+            \param index position of the leaf in the airdrop
+            \param account account name of the recipient
+            \param quantity amount of tokens in the leaf
+            \param proof hashes of sibling nodes from the leaf up to the root
+
+            The recipient calls this action to receive his tokens. The leaf is checked against the airdrop root using \a proof; every leaf can be claimed once. The tokens are transferred from the token contract account to the \a account balance.
+
+            \signreq
+                  — the \a account.
+         */
+         [[eosio::action]]
+         void claimdrop(name id, uint64_t index, name account, asset quantity, vector<checksum256> proof);
+
+         /**
+            \brief The \ref closedrop action closes an airdrop and frees its storage.
+
+            \param id identifier of the airdrop
+
+            The unclaimed tokens are retired from the token contract account and nothing can be claimed anymore. The airdrop record and its bitmap of claimed leaves are deleted; a large bitmap is deleted in parts, so the action should be called again until the airdrop record is gone.
+
+            \signreq
+                  — the token issuer account.
+         */
+         [[eosio::action]]
+         void closedrop(name id);
+
+         /**
+            \brief The \ref chanopen action opens a payment channel and locks funds in it.
+
+            \param from account name of the payer
+            \param to account name of the payee
+            \param id identifier of the channel; must be unique among the payer channels
+            \param quantity amount of tokens to lock in the channel. It must be positive and have correct token symbol
+            \param key public key which signs vouchers of the channel
+            \param delay period in seconds the payee has to settle after the payer requested to close the channel. Must be greater than 0 and not exceed 30 days
+
+            The \a quantity is transferred from the \a from balance to the balance of the token contract account, which holds it while the channel is open. The payer sends the payee vouchers off-chain; a voucher is a signature of sha256 of packed (token contract, from, to, id, nonce, amount), where nonce is the channel nonce (see the channel table) and amount is the total amount paid through the channel. The nonce is taken from the id of the opening transaction, so vouchers of a closed channel are not valid for a channel reopened with the same id in another transaction.
+
+            The \a key is not checked: if it doesn't match the key the payer signs vouchers with, the channel can't be settled and the payee has to close it. Channels don't expire; the payer can get the funds back at any time with \ref chanclose after the \a delay.
+
+            \signreq
+                  — the \a from account.
+         */
+         [[eosio::action]]
+         void chanopen(name from, name to, name id, asset quantity, public_key key, uint32_t delay);
+
+         /**
+            \brief The \ref chansettle action pays out a voucher of a payment channel.
+
+            \param from account name of the payer
+            \param id identifier of the channel
+            \param amount total amount paid through the channel, as signed in the voucher. Must be greater than the already settled amount and not exceed the locked funds
+            \param sig signature of the voucher made by the channel key
+
+            The difference between \a amount and the already settled amount is credited to the payee as payment (it should be claimed with \ref claim). Only the latest voucher needs to be settled.
+
+            \signreq
+                  — the payee of the channel.
+         */
+         [[eosio::action]]
+         void chansettle(name from, name id, asset amount, signature sig);
+
+         /**
+            \brief The \ref chanclose action closes a payment channel.
+
+            \param from account name of the payer
+            \param id identifier of the channel
+
+            If called by the payee, the channel is closed immediately. The payer first calls this action to start the close period (the channel delay), during which the payee can still settle the latest voucher, and then calls it again after the period ends. On close, the funds which were not settled are returned from the token contract account to the payer balance; if the payer balance object was deleted, it's recreated at the payer expense.
+
+            \signreq
+                  — the payee of the channel or the \a from account.
+         */
+         [[eosio::action]]
+         void chanclose(name from, name id);
+
          [[eosio::action]]
          void open( name owner, const symbol& symbol, name ram_payer );
 
          [[eosio::action]]
          void close( name owner, const symbol& symbol );
 
+         struct balance_key {
+             name    owner;
+             symbol  sym;
+         };
+
+         /**
+            \brief The \ref bulkopen action creates zero balances for several owners and tokens.
+
+            \param balances list of balances to create; each entry has an owner and a token symbol
+            \param ram_payer account paying for the created balances
+
+            Works like \ref open for every entry. Token stats are read once per symbol and balances which already exist are skipped.
+
+            \signreq
+                  — the \a ram_payer account.
+         */
+         [[eosio::action]]
+         void bulkopen( vector<balance_key> balances, name ram_payer );
+
+         /**
+            \brief The \ref bulkclose action deletes several zero balances.
+
+            \param balances list of balances to delete; each entry has an owner and a token symbol
+
+            Works like \ref close for every entry, but balances which don't exist are skipped.
+
+            \signreq
+                  — every owner from \a balances.
+         */
+         [[eosio::action]]
+         void bulkclose( vector<balance_key> balances );
+
+         /**
+            \brief The \ref trackholders action enables the holder registry of a token.
+
+            \param sym_code symbol code of the token
+
+            The token issuer calls this action to keep a list of the token holders ordered by balance and their number in the token stats. A holder is an account with a balance object of the token, including zero balances created by \ref open or \ref bulkopen; they are counted and listed (at the end of the order) until the balance object is deleted. Every balance object of the token created after this action is registered automatically and kept in sync on every balance change; balances created earlier can be registered with \ref syncholder. The registry can not be disabled.
+
+            \signreq
+                  — the token issuer account.
+         */
+         [[eosio::action]]
+         void trackholders( symbol_code sym_code );
+
+         /**
+            \brief The \ref syncholder action registers an existing balance in the holder registry.
+
+            \param owner account name of balance owner
+            \param sym_code symbol code of the token; its holder registry must be enabled
+            \param ram_payer account paying for the registry record
+
+            Anyone can call this action to register a balance which was created before the holder registry has been enabled with \ref trackholders. Only the registry record is billed to \a ram_payer; the balance object keeps its payer.
+
+            \signreq
+                  — the \a ram_payer account.
+         */
+         [[eosio::action]]
+         void syncholder( name owner, symbol_code sym_code, name ram_payer );
+
+#ifndef CYBER_TOKEN_LITE
          /**
             \brief The \ref enablesafe action enables a safe on given balance and sets its initial parameters.
 
@@ -160,6 +381,19 @@ namespace eosio {
          */
          [[eosio::action]] void applysafemod(name owner, name mod_id);
 
+         /**
+            \brief The \ref applyready action applies all delayed changes of safes which are ready to apply.
+
+            \param owner account name of safe owner
+            \param sym_code symbol code of tokens to apply changes for; empty value means all tokens
+
+            The balance owner calls this action to apply all delayed changes whose delay has expired in one pass, instead of calling \ref applysafemod for each of them. Changes are applied in order of their ready time. Ready changes which can't be applied (the safe is disabled or the balance is deleted, the change has no effect or overflows unlocked amount) are skipped and kept; they can be removed with \ref cancelsafemod. The action fails if the tokens are locked globally, there are no ready changes or none of them can be applied.
+
+            \signreq
+                  — the \a owner account.
+         */
+         [[eosio::action]] void applyready(name owner, symbol_code sym_code);
+
          /**
             \brief The \ref cancelsafemod action cancels delayed change of a safe (tokens unlock or new parameters, or disable a safe).
 
@@ -184,7 +418,29 @@ namespace eosio {
             \signreq
                   — the \a owner account.
          */
-         [[eosio::action]] void globallock(name owner, uint32_t period); // TODO: Can also add "deletelock" to free storage
+         [[eosio::action]] void globallock(name owner, uint32_t period);
+
+         /**
+            \brief The \ref deletelock action deletes an expired global lock to free storage.
+
+            \param owner account name of tokens owner
+
+            Anyone can call this action to delete the global lock of \a owner after it becomes ineffective. The lock flag is cleared on the flagged balances of \a owner, so their transfers don't read the lock anymore. Expired locks are also deleted automatically when the owner transfers tokens.
+         */
+         [[eosio::action]] void deletelock(name owner);
+
+         /**
+            \brief The \ref synclock action updates the global lock flag of all balances of an account.
+
+            \param owner account name of tokens owner
+
+            Balances store a flag telling that a global lock may be active for their owner, so transfers from other balances don't read the lock. Balances which weren't synced yet (created before the flag was introduced or after the last sync) always read the lock; a balance is synced on a debit only if its owner had a lock. This action syncs all balances of \a owner at once. The RAM of the grown rows is billed to the caller.
+
+            \signreq
+                  — the \a owner account or the token contract account.
+         */
+         [[eosio::action]] void synclock(name owner);
+#endif // CYBER_TOKEN_LITE
 
          static asset get_supply( name token_contract_account, symbol_code sym_code )
          {
@@ -220,6 +476,57 @@ namespace eosio {
             return accountstable.find( sym_code.raw() ) != accountstable.end();
          }
 
+         /**
+            \brief State of a balance for other contracts: balance, payments, safe and global lock
+         */
+         struct balance_view {
+            name           owner;
+            bool           exists = false;  //!< balance object exists, other fields are empty if not
+            asset          balance;
+            asset          payments;
+            bool           has_safe = false;
+            int64_t        unlocked = 0;    //!< amount of unlocked tokens in the safe, share_type
+            uint32_t       delay = 0;       //!< safe delay in seconds
+            time_point_sec lock_unlocks;    //!< time when global lock becomes ineffective, empty if no lock
+
+            bool is_locked() const {
+               return lock_unlocks > eosio::current_time_point();
+            }
+         };
+
+         // Reads the balance object once; the global lock is read unless the balance is synced with it
+         // and unlocked (balances created before the lock flag or not debited since are never synced)
+         static balance_view get_balance_view( name token_contract_account, name owner, symbol_code sym_code )
+         {
+            accounts accountstable( token_contract_account, owner.value );
+            balance_view view{owner};
+            auto ac = accountstable.find( sym_code.raw() );
+            if( ac == accountstable.end() )
+               return view;
+
+            view.exists = true;
+            view.balance = ac->balance;
+            view.payments = ac->payments;
+            view.has_safe = ac->has_safe();
+            if( view.has_safe ) {
+               const auto& safe = ac->safe.value();
+               view.unlocked = safe.unlocked;
+               view.delay = safe.delay;
+            }
+            if( ac->may_be_locked() )
+               view.lock_unlocks = get_global_lock_time( token_contract_account, owner );
+            return view;
+         }
+
+         static vector<balance_view> get_balance_views( name token_contract_account, const vector<name>& owners, symbol_code sym_code )
+         {
+            vector<balance_view> views;
+            views.reserve( owners.size() );
+            for( const auto& owner : owners )
+               views.push_back( get_balance_view( token_contract_account, owner, sym_code ) );
+            return views;
+         }
+
          static inline void validate_symbol(name token_contract, const asset a) {
             validate_symbol(token_contract, a.symbol);
          }
@@ -241,6 +548,13 @@ namespace eosio {
          }
 
       private:
+         /// Lite build (-DCYBER_TOKEN_LITE) has no safes and global locks, the tables are kept as is
+#ifdef CYBER_TOKEN_LITE
+         static constexpr bool lite = true;
+#else
+         static constexpr bool lite = false;
+#endif
+
          struct safe_t {
             int64_t  unlocked;   //!< Amount of unlocked tokens in the safe, share_type
             uint32_t delay;      //!< Delay in seconds of unlock/modify period
@@ -252,16 +566,45 @@ namespace eosio {
             asset    payments;
 
             // the following fields should not be accessed directly (should be in sync)
-            eosio::binary_extension<uint32_t, write_strategy::no_value> version; // if has value, it must be 0. (can be flags to indicate enabled addons; will require custon `unpack`)
+            eosio::binary_extension<uint32_t, write_strategy::no_value> version; // flags; must have value if safe has value, otherwise only if flags are not empty
             eosio::binary_extension<safe_t, write_strategy::no_value> safe;
 
+            static constexpr uint32_t lock_flag = 1;    //!< global lock may be active for the owner
+            static constexpr uint32_t holder_flag = 2;  //!< balance is registered in the holder registry
+            static constexpr uint32_t lock_synced = 4;  //!< lock_flag is in sync with the lock; rows without it must read the lock
+            static constexpr uint32_t known_flags = lock_flag | holder_flag | lock_synced;
+
             void validate() const {
                bool has_ver = version.has_value();
                bool has_safe = safe.has_value();
-               bool valid = has_ver == has_safe && (!has_ver || version.value() == 0);
+               bool valid = (has_ver || !has_safe) &&
+                  (!has_ver || ((version.value() & ~known_flags) == 0 && (has_safe || version.value() != 0)));
                check(valid, "SYS: invalid account structure");
             }
 
+            uint32_t flags() const {
+               return version.has_value() ? version.value() : 0;
+            }
+
+            bool has_flag(uint32_t flag) const {
+               return flags() & flag;
+            }
+
+            void set_flag(uint32_t flag, bool value) {
+               uint32_t new_flags = value ? flags() | flag : flags() & ~flag;
+               if (new_flags || has_safe()) {
+                  version.emplace(new_flags);
+               } else {
+                  version.reset();
+               }
+               validate();
+            }
+
+            // the lock of the owner must be read unless the row is known to be unlocked
+            bool may_be_locked() const {
+               return !has_flag(lock_synced) || has_flag(lock_flag);
+            }
+
             bool has_safe() const {
                return safe.has_value();
             }
@@ -275,7 +618,7 @@ namespace eosio {
             void create_safe(const safe_t& value) {
                validate();
                check(!has_safe(), "SYS: failed to create_safe");
-               version.emplace(0);
+               version.emplace(flags());
                safe.emplace(value);
                validate();
             }
@@ -286,8 +629,10 @@ namespace eosio {
             }
 
             void remove_safe() {
-               version.reset();
                safe.reset();
+               if (!flags()) {
+                  version.reset();
+               }
                validate();
             }
 
@@ -298,6 +643,7 @@ namespace eosio {
             asset    supply;
             asset    max_supply;
             name     issuer;
+            eosio::binary_extension<uint64_t, write_strategy::no_value> holders; // number of holders; has value if holder registry is enabled
 
             uint64_t primary_key()const { return supply.symbol.code().raw(); }
          };
@@ -324,12 +670,72 @@ namespace eosio {
             uint64_t primary_key() const { return id.value; }
             using key_t = std::tuple<symbol_code, name>;
             key_t by_symbol_code() const { return std::make_tuple(sym_code, id); }
+            using date_key_t = std::tuple<time_point_sec, name>;
+            date_key_t by_date() const { return std::make_tuple(date, id); }
 
 #ifndef UNIT_TEST_ENV
             EOSLIB_SERIALIZE(safemod, (id)(sym_code)(date)(unlock)(delay)(trusted))
 #endif
          };
 
+         /**
+            \brief DB record containing information about an airdrop published as a merkle root
+            \ingroup token_tables
+         */
+         // DOCS_TABLE: airdrop
+         struct airdrop {
+            name        id;         //!< identifier of the airdrop
+            checksum256 root;       //!< merkle root of the airdrop leaves
+            asset       total;      //!< total amount of the airdrop
+            asset       claimed;    //!< amount of tokens claimed
+
+            uint64_t primary_key() const { return id.value; }
+         };
+
+         /**
+            \brief DB record containing a part of the bitmap of claimed airdrop leaves; scope = airdrop id
+            \ingroup token_tables
+         */
+         // DOCS_TABLE: dropclaims
+         struct dropclaims {
+            uint64_t word;          //!< index of leaves group: leaf index / 64
+            uint64_t bits;          //!< claimed leaves of the group, bit = leaf index % 64
+
+            uint64_t primary_key() const { return word; }
+         };
+
+         /**
+            \brief DB record containing information about a payment channel; scope = payer
+            \ingroup token_tables
+         */
+         // DOCS_TABLE: channel
+         struct channel {
+            name           id;          //!< identifier of the channel
+            name           to;          //!< account name of the payee
+            asset          deposit;     //!< amount of tokens locked in the channel
+            asset          settled;     //!< amount of tokens already paid to the payee
+            public_key     key;         //!< public key which signs vouchers
+            uint32_t       delay;       //!< period in seconds to settle after the payer requested to close
+            time_point_sec closes;      //!< time when the payer can close the channel, zero if not requested
+            uint64_t       nonce;       //!< first 64 bits of the id of the opening transaction, signed in vouchers
+
+            uint64_t primary_key() const { return id.value; }
+         };
+
+         /**
+            \brief DB record containing information about a token holder; scope = symbol code
+            \ingroup token_tables
+         */
+         // DOCS_TABLE: holder
+         struct holder {
+            name  account;  //!< account name of the holder
+            asset balance;  //!< balance of the holder
+
+            uint64_t primary_key() const { return account.value; }
+            using balance_key_t = std::tuple<int64_t, name>;
+            balance_key_t by_balance() const { return std::make_tuple(balance.amount, account); }
+         };
+
          /**
             \brief DB record containing information about a global lock; singleton; scope = safe owner
             \ingroup token_tables
@@ -346,11 +752,81 @@ namespace eosio {
 
          using safemod_sym_idx [[using eosio: order("sym_code","asc"), order("id","asc")]] =
             eosio::indexed_by<"bysymbolcode"_n, eosio::const_mem_fun<safemod, safemod::key_t, &safemod::by_symbol_code>>;
+         using safemod_date_idx [[using eosio: order("date","asc"), order("id","asc")]] =
+            eosio::indexed_by<"bydate"_n, eosio::const_mem_fun<safemod, safemod::date_key_t, &safemod::by_date>>;
          using safemod_tbl [[eosio::order("id","asc")]] =
-            eosio::multi_index<"safemod"_n, safemod, safemod_sym_idx>;
+            eosio::multi_index<"safemod"_n, safemod, safemod_sym_idx, safemod_date_idx>;
          using lock_singleton [[eosio::order("id","asc")]] =
             eosio::singleton<"lock"_n, lock>;
 
+         using holder_balance_idx [[using eosio: order("balance._amount","desc"), order("account","asc")]] =
+            eosio::indexed_by<"bybalance"_n, eosio::const_mem_fun<holder, holder::balance_key_t, &holder::by_balance>>;
+         using holders [[using eosio: order("account","asc"), scope_type("symbol_code")]] =
+            eosio::multi_index<"holder"_n, holder, holder_balance_idx>;
+
+         using airdrops [[eosio::order("id","asc")]] =
+            eosio::multi_index<"airdrop"_n, airdrop>;
+         using dropclaims_tbl [[eosio::order("word","asc")]] =
+            eosio::multi_index<"dropclaims"_n, dropclaims>;
+
+         using channels [[eosio::order("id","asc")]] =
+            eosio::multi_index<"channel"_n, channel>;
+
+         // Per-action row cache: each row is read from the db once, changes are kept in memory
+         // and every changed row is written once by flush() when the action ends
+         template<typename T>
+         struct cached_row {
+            T    data;
+            name payer;    //!< account to bill on write, empty name means same payer
+            bool stored;   //!< row exists in the db
+            bool alive;    //!< row exists after the action
+            bool dirty;    //!< row must be written
+         };
+
+         using account_key = std::pair<uint64_t, uint64_t>; // owner, symbol code
+
+         std::map<uint64_t, accounts> _accounts_tbls;
+         std::map<uint64_t, stats> _stats_tbls;
+         std::map<uint64_t, lock_singleton> _lock_tbls;
+         std::map<account_key, cached_row<account>> _accounts_cache;
+         std::map<uint64_t, cached_row<currency_stats>> _stats_cache;
+         std::map<uint64_t, cached_row<lock>> _lock_cache;
+
+         // Events are coalesced per action: flush() sends only the last state of every balance and currency
+         std::map<account_key, balance_event> _balance_events;
+         std::map<uint64_t, currency_stats> _currency_events;
+
+         accounts& accounts_table(name owner);
+         cached_row<account>& account_row(name owner, symbol_code sym_code);
+         cached_row<currency_stats>& stat_row(symbol_code sym_code);
+         cached_row<lock>& lock_row(name owner);
+
+         const account* find_account(name owner, symbol_code sym_code);
+         const account& get_account(name owner, symbol_code sym_code, const char* error_msg = "unable to find key");
+         template<typename Lambda>
+         void emplace_account(name owner, name ram_payer, Lambda&& constructor);
+         template<typename Lambda>
+         void modify_account(name owner, const account& acc, name payer, Lambda&& updater);
+         void erase_account(name owner, const account& acc);
+         template<typename Lambda>
+         void for_each_account(name owner, Lambda&& fn);
+
+         const currency_stats* find_stat(symbol_code sym_code);
+         const currency_stats& get_stat(symbol_code sym_code, const char* error_msg = "unable to find key");
+         template<typename Lambda>
+         void emplace_stat(name ram_payer, Lambda&& constructor);
+         template<typename Lambda>
+         void modify_stat(const currency_stats& st, name payer, Lambda&& updater);
+
+         const lock& get_lock(name owner);
+         void set_lock(name owner, const lock& value, name payer);
+         void erase_lock(name owner);
+
+         void flush_holders();
+         void flush();
+
+         void open_balance( name owner, const symbol& symbol, name ram_payer );
+         void close_balance( name owner, const account& acc );
          void sub_balance( name owner, asset value );
          void add_balance( name owner, asset value, name ram_payer );
          void add_payment( name owner, asset value, name ram_payer );
@@ -363,7 +839,56 @@ namespace eosio {
                            const asset& quantity,
                            const string& memo,
                            bool payment = false);
+         // Recipient of a bulk action decoded in place, memo points into the action data
+         struct recipient_view {
+             name             to;
+             asset            quantity;
+             std::string_view memo;
+         };
+
+         // Decodes vector<recipient> from the action data one entry at a time without copying memos
+         class recipients_reader {
+         public:
+            explicit recipients_reader(datastream<const char*>& ds): _ds(ds) {
+               unsigned_int count;
+               _ds >> count;
+               // the count comes from the payload, so it's checked before it's used to reserve memory
+               check(count.value <= _ds.remaining() / min_entry_size, "read");
+               _size = _left = count.value;
+            }
+
+            uint32_t size() const {
+               return _size;
+            }
+
+            bool next(recipient_view& r) {
+               if (!_left) {
+                  return false;
+               }
+               unsigned_int memo_size;
+               _ds >> r.to >> r.quantity >> memo_size;
+               check(_ds.remaining() >= memo_size.value, "read");
+               r.memo = std::string_view(_ds.pos(), memo_size.value);
+               _ds.skip(memo_size.value);
+               --_left;
+               return true;
+            }
+
+         private:
+            static constexpr size_t min_entry_size = sizeof(name) + sizeof(asset) + 1;  // name, asset, empty memo
+
+            datastream<const char*>& _ds;
+            uint32_t _size;
+            uint32_t _left;
+         };
+
+         void do_bulk_transfer( name from, recipients_reader recipients, bool payment = false,
+                                bool single_symbol = true );
+         void do_bulk_transfer( bool payment, bool single_symbol );
 
+         static bool safe_change_applies(const account* acc, const safemod& mod);
+         void instant_safe_change(name owner, const account& acc,
+            int64_t unlock, std::optional<uint32_t> delay, std::optional<name> trusted, bool ensure_change);
          void delay_safe_change(
             name owner, asset unlock, name mod_id, std::optional<uint32_t> delay, std::optional<name> trusted,
             bool check_params = true, bool check_sym = true);
@@ -371,10 +896,41 @@ namespace eosio {
             name owner, symbol_code sym_code, name mod_id, std::optional<uint32_t> delay, std::optional<name> trusted,
             bool check_params = true);
 
-         static inline bool is_locked(name token_contract, name owner) {
-            lock_singleton lock(token_contract, owner.value);
-            return lock.exists() && lock.get().unlocks > eosio::current_time_point();
+         struct access_counters {
+            uint32_t accounts_reads = 0;
+            uint32_t accounts_writes = 0;
+            uint32_t stats_reads = 0;
+            uint32_t stats_writes = 0;
+            uint32_t safemod_reads = 0;
+            uint32_t safemod_writes = 0;
+            uint32_t lock_reads = 0;
+            uint32_t lock_writes = 0;
+            uint32_t is_account_calls = 0;
+            uint32_t events = 0;
+         };
+
+         // Instrumented build (-DCYBER_TOKEN_INSTRUMENT) prints db access counters of every action;
+         // in other builds count() is empty and the class has no counters
+#ifdef CYBER_TOKEN_INSTRUMENT
+         access_counters _counters;
+
+         void count(uint32_t access_counters::* counter, uint32_t n = 1) {
+            _counters.*counter += n;
          }
+         void print_counters() const;
+         // shadows eosio::is_account inside the contract to count the calls
+         bool is_account(name n) {
+            count(&access_counters::is_account_calls);
+            return eosio::is_account(n);
+         }
+#else
+         void count(uint32_t access_counters::*, uint32_t = 1) {}
+#endif
+         void check_safe_params(name owner, std::optional<uint32_t> delay, std::optional<name> trusted);
+
+         void check_symbol(const symbol& sym);
+         bool is_locked(name owner);
+         void check_unlocked(name owner, const account& acc, const char* error_msg);
 
    };
 } /// namespace eosio
@@ -4,8 +4,15 @@
  */
 
 #include <eosio/event.hpp>
+#include <eosio/transaction.hpp>
 #include <cyber.token/cyber.token.hpp>
-#include <set>
+#include <algorithm>
+#include <array>
+
+// max delay and max lock period (30 days), a literal to be used in the messages
+#define SAFE_MAX_DELAY 2592000
+#define STRINGIFY_(x) #x
+#define STRINGIFY(x) STRINGIFY_(x)
 
 namespace eosio {
 
@@ -13,18 +20,362 @@ namespace config {
     static constexpr size_t max_memo_size = 384;
     static constexpr char memo_error[] = "memo has more than 384 bytes";
     const uint32_t seconds_per_day = 24 * 60 * 60; // TODO: move to some global consts
-    static constexpr uint32_t safe_max_delay = 30 * seconds_per_day; // max delay and max lock period
+    static constexpr uint32_t safe_max_delay = SAFE_MAX_DELAY; // max delay and max lock period
+    static_assert(safe_max_delay == 30 * seconds_per_day);
+    static constexpr size_t max_dropclaims_erase = 256;  // max bitmap rows of an airdrop to erase per closedrop
+    static constexpr char delay_error[] = "delay must be <= " STRINGIFY(SAFE_MAX_DELAY);
+    static constexpr char period_error[] = "period must be <= " STRINGIFY(SAFE_MAX_DELAY);
+}
+
+using credit_t = std::pair<name, asset>;
+
+// Sorts credits by recipient and merges amounts of repeated recipients (a flat container is used
+// instead of a node-based one; note the row cache and events still keep a node per distinct balance)
+static void merge_credits(vector<credit_t>& credits) {
+    std::sort(credits.begin(), credits.end(), [](const auto& l, const auto& r) { return l.first < r.first; });
+    auto last = credits.begin();
+    for (auto itr = credits.begin(); itr != credits.end(); ++itr) {
+        if (itr == last) continue;
+        if (itr->first == last->first) {
+            last->second += itr->second;    // asset addition checks overflow
+        } else {
+            *++last = *itr;
+        }
+    }
+    if (!credits.empty()) {
+        credits.erase(++last, credits.end());
+    }
+}
+
+static void sort_unique(vector<name>& names) {
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+}
+
+// Removes repeated names keeping the order of first appearance, so accounts are notified
+// in the same order as by a loop over the payload
+static void unique_in_order(vector<name>& names) {
+    vector<std::pair<name, size_t>> seen;
+    seen.reserve(names.size());
+    for (size_t i = 0; i < names.size(); ++i) {
+        seen.emplace_back(names[i], i);
+    }
+    std::sort(seen.begin(), seen.end());    // the first appearance of a name goes first
+    seen.erase(std::unique(seen.begin(), seen.end(), [](const auto& l, const auto& r) { return l.first == r.first; }), seen.end());
+    std::sort(seen.begin(), seen.end(), [](const auto& l, const auto& r) { return l.second < r.second; });
+    names.clear();
+    for (const auto& item : seen) {
+        names.push_back(item.first);
+    }
 }
 
+// events are only recorded here and sent once per balance/currency by flush()
 void token::send_currency_event(const currency_stats& stat) {
-    eosio::event(_self, "currency"_n, stat).send();
+    _currency_events[stat.primary_key()] = stat;
 }
 
 void token::send_balance_event(name acc, const account& accinfo) {
-    balance_event data{acc, accinfo.balance, accinfo.payments};
-    eosio::event(_self, "balance"_n, data).send();
+    _balance_events[account_key{acc.value, accinfo.primary_key()}] = balance_event{acc, accinfo.balance, accinfo.payments};
+}
+
+////////////////////////////////////////////////////////////////
+// per-action row cache
+token::~token() {
+    flush();
+#ifdef CYBER_TOKEN_INSTRUMENT
+    print_counters();
+#endif
+}
+
+#ifdef CYBER_TOKEN_INSTRUMENT
+void token::print_counters() const {
+    const auto& c = _counters;
+    eosio::print("{\"accounts\":[", c.accounts_reads, ",", c.accounts_writes,
+        "],\"stats\":[", c.stats_reads, ",", c.stats_writes,
+        "],\"safemod\":[", c.safemod_reads, ",", c.safemod_writes,
+        "],\"lock\":[", c.lock_reads, ",", c.lock_writes,
+        "],\"is_account\":", c.is_account_calls, ",\"events\":", c.events, "}\n");
+}
+#endif
+
+token::accounts& token::accounts_table(name owner) {
+    return _accounts_tbls.try_emplace(owner.value, _self, owner.value).first->second;
+}
+
+token::cached_row<token::account>& token::account_row(name owner, symbol_code sym_code) {
+    const account_key key{owner.value, sym_code.raw()};
+    auto itr = _accounts_cache.find(key);
+    if (itr == _accounts_cache.end()) {
+        auto& tbl = accounts_table(owner);
+        auto row = tbl.find(sym_code.raw());
+        count(&access_counters::accounts_reads);
+        bool stored = row != tbl.end();
+        itr = _accounts_cache.emplace(key, cached_row<account>{stored ? *row : account{}, name(), stored, stored, false}).first;
+    }
+    return itr->second;
+}
+
+token::cached_row<token::currency_stats>& token::stat_row(symbol_code sym_code) {
+    auto itr = _stats_cache.find(sym_code.raw());
+    if (itr == _stats_cache.end()) {
+        auto& tbl = _stats_tbls.try_emplace(sym_code.raw(), _self, sym_code.raw()).first->second;
+        auto row = tbl.find(sym_code.raw());
+        count(&access_counters::stats_reads);
+        bool stored = row != tbl.end();
+        itr = _stats_cache.emplace(sym_code.raw(),
+            cached_row<currency_stats>{stored ? *row : currency_stats{}, name(), stored, stored, false}).first;
+    }
+    return itr->second;
+}
+
+token::cached_row<token::lock>& token::lock_row(name owner) {
+    auto itr = _lock_cache.find(owner.value);
+    if (itr == _lock_cache.end()) {
+        auto& tbl = _lock_tbls.try_emplace(owner.value, _self, owner.value).first->second;
+        bool stored = tbl.exists();
+        count(&access_counters::lock_reads);    // get() is answered from the item cache of exists()
+        itr = _lock_cache.emplace(owner.value, cached_row<lock>{stored ? tbl.get() : lock{}, name(), stored, stored, false}).first;
+    }
+    return itr->second;
+}
+
+const token::account* token::find_account(name owner, symbol_code sym_code) {
+    const auto& row = account_row(owner, sym_code);
+    return row.alive ? &row.data : nullptr;
+}
+
+const token::account& token::get_account(name owner, symbol_code sym_code, const char* error_msg) {
+    const auto* acc = find_account(owner, sym_code);
+    eosio::check(acc != nullptr, error_msg);
+    return *acc;
+}
+
+template<typename Lambda>
+void token::emplace_account(name owner, name ram_payer, Lambda&& constructor) {
+    account value{};
+    constructor(value);
+    // the stat is already loaded by every caller to check the symbol, so it's taken from the cache
+    // to avoid a stats lookup per new balance
+    const auto st = _stats_cache.find(value.balance.symbol.code().raw());
+    eosio::check(st != _stats_cache.end() && st->second.alive, "SYS: token stats are not loaded");
+    if (st->second.data.holders.has_value()) {
+        value.set_flag(account::holder_flag, true);
+    }
+    auto& row = account_row(owner, value.balance.symbol.code());
+    eosio::check(!row.alive, "SYS: account object already exists");
+    row.data = value;
+    row.payer = ram_payer;
+    row.alive = row.dirty = true;
+}
+
+template<typename Lambda>
+void token::modify_account(name owner, const account& acc, name payer, Lambda&& updater) {
+    auto& row = account_row(owner, acc.balance.symbol.code());
+    eosio::check(row.alive && &row.data == &acc, "SYS: object passed to modify is not in the cache");
+    const auto pk = row.data.primary_key();
+    updater(row.data);
+    eosio::check(pk == row.data.primary_key(), "updater cannot change primary key when modifying an object");
+    if (payer != same_payer) {
+        row.payer = payer;
+    }
+    row.dirty = true;
+}
+
+void token::erase_account(name owner, const account& acc) {
+    auto& row = account_row(owner, acc.balance.symbol.code());
+    eosio::check(row.alive && &row.data == &acc, "SYS: object passed to erase is not in the cache");
+    row.alive = false;
+    row.dirty = true;
+}
+
+// calls fn for every balance of the owner (loads all of them into the cache)
+template<typename Lambda>
+void token::for_each_account(name owner, Lambda&& fn) {
+    for (const auto& acc : accounts_table(owner)) {
+        account_row(owner, acc.balance.symbol.code());
+    }
+    auto itr = _accounts_cache.lower_bound(account_key{owner.value, 0});
+    for (; itr != _accounts_cache.end() && itr->first.first == owner.value; ++itr) {
+        if (itr->second.alive) {
+            fn(itr->second.data);
+        }
+    }
+}
+
+const token::currency_stats* token::find_stat(symbol_code sym_code) {
+    const auto& row = stat_row(sym_code);
+    return row.alive ? &row.data : nullptr;
+}
+
+const token::currency_stats& token::get_stat(symbol_code sym_code, const char* error_msg) {
+    const auto* st = find_stat(sym_code);
+    eosio::check(st != nullptr, error_msg);
+    return *st;
+}
+
+template<typename Lambda>
+void token::emplace_stat(name ram_payer, Lambda&& constructor) {
+    currency_stats value{};
+    constructor(value);
+    auto& row = stat_row(value.supply.symbol.code());
+    eosio::check(!row.alive, "SYS: stat object already exists");
+    row.data = value;
+    row.payer = ram_payer;
+    row.alive = row.dirty = true;
+}
+
+template<typename Lambda>
+void token::modify_stat(const currency_stats& st, name payer, Lambda&& updater) {
+    auto& row = stat_row(st.supply.symbol.code());
+    eosio::check(row.alive && &row.data == &st, "SYS: object passed to modify is not in the cache");
+    const auto pk = row.data.primary_key();
+    updater(row.data);
+    eosio::check(pk == row.data.primary_key(), "updater cannot change primary key when modifying an object");
+    if (payer != same_payer) {
+        row.payer = payer;
+    }
+    row.dirty = true;
+}
+
+const token::lock& token::get_lock(name owner) {
+    return lock_row(owner).data;    // default value if lock doesn't exist
+}
+
+void token::set_lock(name owner, const lock& value, name payer) {
+    auto& row = lock_row(owner);
+    row.data = value;
+    row.payer = payer;
+    row.alive = row.dirty = true;
+}
+
+void token::erase_lock(name owner) {
+    auto& row = lock_row(owner);
+    row.data = lock{};
+    row.alive = false;
+    row.dirty = true;
+}
+
+// updates the holder registry from the changed balances, must be called before the stats are written
+void token::flush_holders() {
+    for (const auto& item : _accounts_cache) {
+        const auto& row = item.second;
+        if (!row.dirty || !row.data.has_flag(account::holder_flag)) continue;
+        const name owner{item.first.first};
+        const symbol_code sym_code{item.first.second};
+
+        holders tbl(_self, sym_code.raw());
+        auto itr = tbl.find(owner.value);
+        int64_t delta = 0;
+        if (!row.alive) {
+            if (itr != tbl.end()) {
+                tbl.erase(itr);
+                delta = -1;
+            }
+        } else if (itr == tbl.end()) {
+            tbl.emplace(row.payer != name() ? row.payer : owner, [&](auto& h) {
+                h.account = owner;
+                h.balance = row.data.balance;
+            });
+            delta = 1;
+        } else if (itr->balance != row.data.balance) {
+            tbl.modify(itr, same_payer, [&](auto& h) {
+                h.balance = row.data.balance;
+            });
+        }
+
+        if (delta) {
+            modify_stat(get_stat(sym_code), same_payer, [&](auto& s) {
+                s.holders.emplace(s.holders.value() + delta);
+                send_currency_event(s);
+            });
+        }
+    }
 }
 
+void token::flush() {
+    flush_holders();
+    for (auto& item : _stats_cache) {
+        auto& row = item.second;
+        if (!row.dirty) continue;
+        auto& tbl = _stats_tbls.at(item.first);
+        count(&access_counters::stats_writes);
+        if (row.stored) {
+            tbl.modify(tbl.find(item.first), row.payer, [&](auto& s) { s = row.data; });
+        } else {
+            tbl.emplace(row.payer, [&](auto& s) { s = row.data; });
+        }
+    }
+    for (auto& item : _accounts_cache) {
+        auto& row = item.second;
+        if (!row.dirty) continue;
+        auto& tbl = _accounts_tbls.at(item.first.first);
+        count(&access_counters::accounts_writes, row.stored || row.alive);
+        if (row.stored && !row.alive) {
+            tbl.erase(tbl.find(item.first.second));
+        } else if (row.stored) {
+            tbl.modify(tbl.find(item.first.second), row.payer, [&](auto& a) { a = row.data; });
+        } else if (row.alive) {
+            tbl.emplace(row.payer, [&](auto& a) { a = row.data; });
+        }
+    }
+    for (auto& item : _lock_cache) {
+        auto& row = item.second;
+        if (!row.dirty) continue;
+        auto& tbl = _lock_tbls.at(item.first);
+        count(&access_counters::lock_writes, row.stored || row.alive);
+        if (row.alive) {
+            tbl.set(row.data, row.payer);
+        } else if (row.stored) {
+            tbl.remove();
+        }
+    }
+    _stats_cache.clear();
+    _accounts_cache.clear();
+    _lock_cache.clear();
+
+    count(&access_counters::events, static_cast<uint32_t>(_currency_events.size() + _balance_events.size()));
+    for (const auto& item : _currency_events) {
+        eosio::event(_self, "currency"_n, item.second).send();
+    }
+    for (const auto& item : _balance_events) {
+        eosio::event(_self, "balance"_n, item.second).send();
+    }
+    _currency_events.clear();
+    _balance_events.clear();
+}
+
+void token::check_symbol(const symbol& sym) {
+    eosio::check(get_stat(sym.code()).supply.symbol == sym, "symbol precision mismatch");
+}
+
+#ifndef CYBER_TOKEN_LITE
+bool token::is_locked(name owner) {
+    return get_lock(owner).unlocks > eosio::current_time_point();
+}
+
+// Checks global lock of the debited balance. The lock is read unless the balance is synced and has no
+// lock flag (new and legacy balances are not synced). If the owner has (expired) lock or the balance is
+// flagged, the lock is erased and the balance is marked as synced and unlocked to skip the lookup next
+// time; other balances aren't rewritten, so plain balance rows don't grow by the flags word
+void token::check_unlocked(name owner, const account& acc, const char* error_msg) {
+    if (!acc.may_be_locked()) {
+        return;
+    }
+    check(!is_locked(owner), error_msg);
+    const bool has_lock = lock_row(owner).alive;
+    if (!has_lock && !acc.has_flag(account::lock_flag)) {
+        return;
+    }
+    if (has_lock) {
+        erase_lock(owner);
+    }
+    modify_account(owner, acc, owner, [](auto& a) {
+        a.set_flag(account::lock_flag, false);
+        a.set_flag(account::lock_synced, true);
+    });
+}
+#endif // CYBER_TOKEN_LITE
+
 void token::create( name   issuer,
                     asset  maximum_supply )
 {
@@ -36,11 +387,9 @@ void token::create( name   issuer,
     eosio::check( maximum_supply.is_valid(), "invalid supply");
     eosio::check( maximum_supply.amount > 0, "max-supply must be positive");
 
-    stats statstable( _self, sym.code().raw() );
-    auto existing = statstable.find( sym.code().raw() );
-    eosio::check( existing == statstable.end(), "token with symbol already exists" );
+    eosio::check( find_stat( sym.code() ) == nullptr, "token with symbol already exists" );
 
-    statstable.emplace( _self, [&]( auto& s ) {
+    emplace_stat( _self, [&]( auto& s ) {
        s.supply.symbol = maximum_supply.symbol;
        s.max_supply    = maximum_supply;
        s.issuer        = issuer;
@@ -56,9 +405,8 @@ void token::issue( name to, asset quantity, string memo )
     eosio::check( sym.is_valid(), "invalid symbol name" );
     eosio::check( memo.size() <= config::max_memo_size, config::memo_error );
 
-    stats statstable( _self, sym.code().raw() );
-    auto existing = statstable.find( sym.code().raw() );
-    eosio::check( existing != statstable.end(), "token with symbol does not exist, create token before issue" );
+    const auto* existing = find_stat( sym.code() );
+    eosio::check( existing != nullptr, "token with symbol does not exist, create token before issue" );
     const auto& st = *existing;
 
     require_auth( st.issuer );
@@ -68,7 +416,7 @@ void token::issue( name to, asset quantity, string memo )
     eosio::check( quantity.symbol == st.supply.symbol, "symbol precision mismatch" );
     eosio::check( quantity.amount <= st.max_supply.amount - st.supply.amount, "quantity exceeds available supply");
 
-    statstable.modify( st, same_payer, [&]( auto& s ) {
+    modify_stat( st, same_payer, [&]( auto& s ) {
        s.supply += quantity;
        send_currency_event(s);
     });
@@ -82,15 +430,61 @@ void token::issue( name to, asset quantity, string memo )
     }
 }
 
+void token::bulkissue( ignore<vector<recipient>> )
+{
+    recipients_reader recipients(_ds);
+    recipient_view recipient_obj;
+    eosio::check( recipients.next(recipient_obj), "recipients must not be empty" );
+    const auto sym = recipient_obj.quantity.symbol;
+    eosio::check( sym.is_valid(), "invalid symbol name" );
+
+    const auto* existing = find_stat( sym.code() );
+    eosio::check( existing != nullptr, "token with symbol does not exist, create token before issue" );
+    const auto& st = *existing;
+
+    require_auth( st.issuer );
+    require_recipient( st.issuer );
+
+    asset total{0, st.supply.symbol};
+    vector<credit_t> credits;
+    credits.reserve(recipients.size());
+    do {
+        const auto& quantity = recipient_obj.quantity;
+        eosio::check( sym == quantity.symbol, "issue of different tokens is prohibited" );
+        eosio::check( recipient_obj.memo.size() <= config::max_memo_size, config::memo_error );
+        eosio::check( quantity.is_valid(), "invalid quantity" );
+        eosio::check( quantity.amount > 0, "must issue positive quantity" );
+        eosio::check( quantity.symbol == st.supply.symbol, "symbol precision mismatch" );
+        total += quantity;  // asset addition checks overflow
+        credits.emplace_back(recipient_obj.to, quantity);
+    } while (recipients.next(recipient_obj));
+    eosio::check( total.amount <= st.max_supply.amount - st.supply.amount, "quantity exceeds available supply");
+
+    merge_credits(credits);
+    for (const auto& credit : credits) {
+        eosio::check( is_account(credit.first), "to account does not exist" );
+        require_recipient( credit.first );
+    }
+
+    modify_stat( st, same_payer, [&]( auto& s ) {
+       s.supply += total;
+       send_currency_event(s);
+    });
+
+    for (const auto& credit : credits) {
+        auto payer = has_auth(credit.first) ? credit.first : st.issuer;
+        add_balance( credit.first, credit.second, payer );
+    }
+}
+
 void token::retire( asset quantity, string memo )
 {
     auto sym = quantity.symbol;
     eosio::check( sym.is_valid(), "invalid symbol name" );
     eosio::check( memo.size() <= config::max_memo_size, config::memo_error );
 
-    stats statstable( _self, sym.code().raw() );
-    auto existing = statstable.find( sym.code().raw() );
-    eosio::check( existing != statstable.end(), "token with symbol does not exist" );
+    const auto* existing = find_stat( sym.code() );
+    eosio::check( existing != nullptr, "token with symbol does not exist" );
     const auto& st = *existing;
 
     require_auth( st.issuer );
@@ -99,7 +493,7 @@ void token::retire( asset quantity, string memo )
 
     eosio::check( quantity.symbol == st.supply.symbol, "symbol precision mismatch" );
 
-    statstable.modify( st, same_payer, [&]( auto& s ) {
+    modify_stat( st, same_payer, [&]( auto& s ) {
        s.supply -= quantity;
        send_currency_event(s);
     });
@@ -135,9 +529,7 @@ void token::do_transfer( name  from,
         eosio::check( from != to, "cannot transfer to self" );
     require_auth( from );
     eosio::check( is_account( to ), "to account does not exist");
-    auto sym = quantity.symbol.code();
-    stats statstable( _self, sym.raw() );
-    const auto& st = statstable.get( sym.raw() );
+    const auto& st = get_stat( quantity.symbol.code() );
 
     eosio::check( quantity.is_valid(), "invalid quantity" );
     eosio::check( quantity.amount > 0, "must transfer positive quantity" );
@@ -154,39 +546,38 @@ void token::do_transfer( name  from,
 }
 
 void token::sub_balance( name owner, asset value ) {
-   accounts from_acnts( _self, owner.value );
-
-   const auto& from = from_acnts.get( value.symbol.code().raw(), "no balance object found" );
+   const auto& from = get_account( owner, value.symbol.code(), "no balance object found" );
    eosio::check( from.balance.amount >= value.amount, "overdrawn balance" );
 
-   from_acnts.modify( from, owner, [&]( auto& a ) {
+   modify_account( owner, from, owner, [&]( auto& a ) {
          a.balance -= value;
          send_balance_event(owner, a);
       });
 
-   check(!is_locked(_self, owner), "balance locked in safe");
-   if (from.has_safe()) {
-      from_acnts.modify(from, owner, [&](auto& a) {
-         auto safe = a.get_safe();
-         safe.unlocked -= value.amount;
-         check(safe.unlocked >= 0, "overdrawn safe unlocked balance");
-         a.modify_safe(safe);
-      });
+   if constexpr (!lite) {
+      check_unlocked(owner, from, "balance locked in safe");
+      if (from.has_safe()) {
+         modify_account(owner, from, owner, [&](auto& a) {
+            auto safe = a.get_safe();
+            safe.unlocked -= value.amount;
+            check(safe.unlocked >= 0, "overdrawn safe unlocked balance");
+            a.modify_safe(safe);
+         });
+      }
    }
 }
 
 void token::add_balance( name owner, asset value, name ram_payer )
 {
-   accounts to_acnts( _self, owner.value );
-   auto to = to_acnts.find( value.symbol.code().raw() );
-   if( to == to_acnts.end() ) {
-      to_acnts.emplace( ram_payer, [&]( auto& a ){
+   const auto* to = find_account( owner, value.symbol.code() );
+   if( to == nullptr ) {
+      emplace_account( owner, ram_payer, [&]( auto& a ){
         a.balance = value;
         a.payments.symbol = value.symbol;
         send_balance_event(owner, a);
       });
    } else {
-      to_acnts.modify( to, same_payer, [&]( auto& a ) {
+      modify_account( owner, *to, same_payer, [&]( auto& a ) {
         a.balance += value;
         send_balance_event(owner, a);
       });
@@ -195,54 +586,334 @@ void token::add_balance( name owner, asset value, name ram_payer )
 
 void token::add_payment( name owner, asset value, name ram_payer )
 {
-   accounts to_acnts( _self, owner.value );
-   auto to = to_acnts.find( value.symbol.code().raw() );
-   if( to == to_acnts.end() ) {
-      to_acnts.emplace( ram_payer, [&]( auto& a ){
+   const auto* to = find_account( owner, value.symbol.code() );
+   if( to == nullptr ) {
+      emplace_account( owner, ram_payer, [&]( auto& a ){
         a.balance.symbol = value.symbol;
         a.payments = value;
         send_balance_event(owner, a);
       });
    } else {
-      to_acnts.modify( to, same_payer, [&]( auto& a ) {
+      modify_account( owner, *to, same_payer, [&]( auto& a ) {
         a.payments += value;
         send_balance_event(owner, a);
       });
    }
 }
 
-void token::open( name owner, const symbol& symbol, name ram_payer )
+void token::open_balance( name owner, const symbol& symbol, name ram_payer )
 {
-   require_auth( ram_payer );
-   eosio::check( is_account( owner ), "owner account does not exist");
-
-   auto sym_code_raw = symbol.code().raw();
-
-   stats statstable( _self, sym_code_raw );
-   const auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+   const auto& st = get_stat( symbol.code(), "symbol does not exist" );
    eosio::check( st.supply.symbol == symbol, "symbol precision mismatch" );
 
-   accounts acnts( _self, owner.value );
-   auto it = acnts.find( sym_code_raw );
-   if( it == acnts.end() ) {
-      acnts.emplace( ram_payer, [&]( auto& a ){
+   if( find_account( owner, symbol.code() ) == nullptr ) {
+      emplace_account( owner, ram_payer, [&]( auto& a ){
         a.balance = asset{0, symbol};
         a.payments = asset{0, symbol};
       });
    }
 }
 
+void token::close_balance( name owner, const account& acc )
+{
+   eosio::check( acc.balance.amount == 0, "Cannot close because the balance is not zero." );
+   eosio::check( acc.payments.amount == 0, "Cannot close because account has payments." );
+   eosio::check( !acc.has_safe(), "Cannot close because safe enabled." );
+   acc.validate();
+   erase_account( owner, acc );
+}
+
+void token::open( name owner, const symbol& symbol, name ram_payer )
+{
+   require_auth( ram_payer );
+   eosio::check( is_account( owner ), "owner account does not exist");
+   open_balance( owner, symbol, ram_payer );
+}
+
 void token::close( name owner, const symbol& symbol )
 {
    require_auth( owner );
-   accounts acnts( _self, owner.value );
-   auto it = acnts.find( symbol.code().raw() );
-   eosio::check( it != acnts.end(), "Balance row already deleted or never existed. Action won't have any effect." );
-   eosio::check( it->balance.amount == 0, "Cannot close because the balance is not zero." );
-   eosio::check( it->payments.amount == 0, "Cannot close because account has payments." );
-   eosio::check( !it->has_safe(), "Cannot close because safe enabled." );
-   it->validate();
-   acnts.erase( it );
+   const auto* it = find_account( owner, symbol.code() );
+   eosio::check( it != nullptr, "Balance row already deleted or never existed. Action won't have any effect." );
+   close_balance( owner, *it );
+}
+
+void token::bulkopen( vector<balance_key> balances, name ram_payer )
+{
+   require_auth( ram_payer );
+   eosio::check( balances.size(), "balances must not be empty" );
+
+   vector<name> owners;
+   owners.reserve( balances.size() );
+   for( const auto& b : balances ) {
+      owners.push_back( b.owner );
+   }
+   sort_unique( owners );
+   for( auto owner : owners ) {
+      eosio::check( is_account( owner ), "owner account does not exist");
+   }
+
+   // stats are read once per symbol through the row cache, existing balances are skipped
+   for( const auto& b : balances ) {
+      open_balance( b.owner, b.sym, ram_payer );
+   }
+}
+
+void token::bulkclose( vector<balance_key> balances )
+{
+   eosio::check( balances.size(), "balances must not be empty" );
+
+   vector<name> owners;
+   owners.reserve( balances.size() );
+   for( const auto& b : balances ) {
+      owners.push_back( b.owner );
+   }
+   sort_unique( owners );
+   for( auto owner : owners ) {
+      require_auth( owner );
+   }
+
+   // missing balances are skipped, so the same list can be closed again
+   for( const auto& b : balances ) {
+      const auto* it = find_account( b.owner, b.sym.code() );
+      if( it != nullptr ) {
+         close_balance( b.owner, *it );
+      }
+   }
+}
+
+void token::trackholders( symbol_code sym_code )
+{
+   const auto& st = get_stat( sym_code, "symbol does not exist" );
+   require_auth( st.issuer );
+   eosio::check( !st.holders.has_value(), "holder registry already enabled" );
+
+   modify_stat( st, same_payer, [&]( auto& s ) {
+      s.holders.emplace(0);
+      send_currency_event(s);
+   });
+}
+
+void token::syncholder( name owner, symbol_code sym_code, name ram_payer )
+{
+   require_auth( ram_payer );
+   const auto& st = get_stat( sym_code, "symbol does not exist" );
+   eosio::check( st.holders.has_value(), "holder registry disabled" );
+
+   const auto& acc = get_account( owner, sym_code, "no balance object found" );
+   eosio::check( !acc.has_flag(account::holder_flag), "balance already registered" );
+
+   holders tbl( _self, sym_code.raw() );
+   tbl.emplace( ram_payer, [&]( auto& h ) {
+      h.account = owner;
+      h.balance = acc.balance;
+   });
+   modify_stat( st, same_payer, [&]( auto& s ) {
+      s.holders.emplace(s.holders.value() + 1);
+      send_currency_event(s);
+   });
+   modify_account( owner, acc, same_payer, []( auto& a ) {
+      a.set_flag(account::holder_flag, true);
+   });
+}
+
+void token::setdrop( name id, asset total, checksum256 root )
+{
+   eosio::check( total.symbol.is_valid(), "invalid symbol name" );
+   const auto& st = get_stat( total.symbol.code(), "symbol does not exist" );
+   require_auth( st.issuer );
+
+   eosio::check( total.is_valid(), "invalid quantity" );
+   eosio::check( total.amount > 0, "must issue positive quantity" );
+   eosio::check( total.symbol == st.supply.symbol, "symbol precision mismatch" );
+   eosio::check( total.amount <= st.max_supply.amount - st.supply.amount, "quantity exceeds available supply");
+
+   airdrops drops( _self, _self.value );
+   eosio::check( drops.find( id.value ) == drops.end(), "airdrop with the same id already exists" );
+   drops.emplace( st.issuer, [&]( auto& d ) {
+      d.id = id;
+      d.root = root;
+      d.total = total;
+      d.claimed = asset{0, total.symbol};
+   });
+
+   // the total is issued to the contract account, so several airdrops can't count on the same supply
+   modify_stat( st, same_payer, [&]( auto& s ) {
+      s.supply += total;
+      send_currency_event(s);
+   });
+   add_balance( _self, total, st.issuer );
+}
+
+// hash of two merkle tree nodes
+static checksum256 merkle_parent( const checksum256& left, const checksum256& right )
+{
+   std::array<uint8_t, 64> data;
+   const auto l = left.extract_as_byte_array();
+   const auto r = right.extract_as_byte_array();
+   std::copy( l.begin(), l.end(), data.begin() );
+   std::copy( r.begin(), r.end(), data.begin() + l.size() );
+   return eosio::sha256( reinterpret_cast<const char*>( data.data() ), data.size() );
+}
+
+void token::claimdrop( name id, uint64_t index, name account, asset quantity, vector<checksum256> proof )
+{
+   require_auth( account );
+
+   airdrops drops( _self, _self.value );
+   const auto& drop = drops.get( id.value, "airdrop not found" );
+   eosio::check( quantity.symbol == drop.total.symbol, "symbol precision mismatch" );
+   eosio::check( quantity.amount > 0, "must issue positive quantity" );
+   eosio::check( proof.size() <= 64, "proof is too long" );
+
+   const auto leaf_data = eosio::pack( std::make_tuple( index, account, quantity ) );
+   auto node = eosio::sha256( leaf_data.data(), leaf_data.size() );
+   for( size_t level = 0; level < proof.size(); ++level ) {
+      node = (index >> level) & 1 ? merkle_parent( proof[level], node ) : merkle_parent( node, proof[level] );
+   }
+   eosio::check( node == drop.root, "invalid proof" );
+
+   dropclaims_tbl claims( _self, id.value );
+   const uint64_t word = index / 64;
+   const uint64_t bit = uint64_t(1) << (index % 64);
+   auto claimed = claims.find( word );
+   if( claimed == claims.end() ) {
+      claims.emplace( account, [&]( auto& c ) {
+         c.word = word;
+         c.bits = bit;
+      });
+   } else {
+      eosio::check( !(claimed->bits & bit), "airdrop already claimed" );
+      claims.modify( claimed, same_payer, [&]( auto& c ) {
+         c.bits |= bit;
+      });
+   }
+
+   eosio::check( quantity.amount <= drop.total.amount - drop.claimed.amount, "quantity exceeds airdrop total" );
+   drops.modify( drop, same_payer, [&]( auto& d ) {
+      d.claimed += quantity;
+   });
+
+   check_symbol( quantity.symbol );
+   sub_balance( _self, quantity );
+   add_balance( account, quantity, account );
+}
+
+void token::closedrop( name id )
+{
+   airdrops drops( _self, _self.value );
+   const auto& drop = drops.get( id.value, "airdrop not found" );
+   const auto& st = get_stat( drop.total.symbol.code() );
+   require_auth( st.issuer );
+
+   if( drop.claimed < drop.total ) {
+      const auto unclaimed = drop.total - drop.claimed;
+      modify_stat( st, same_payer, [&]( auto& s ) {
+         s.supply -= unclaimed;
+         send_currency_event(s);
+      });
+      sub_balance( _self, unclaimed );
+      drops.modify( drop, same_payer, [&]( auto& d ) {
+         d.total = d.claimed;   // nothing can be claimed anymore
+      });
+   }
+
+   dropclaims_tbl claims( _self, id.value );
+   size_t erased = 0;
+   for( auto itr = claims.begin(); itr != claims.end(); ) {
+      if( erased == config::max_dropclaims_erase ) {
+         return;    // the rest is erased by the next call
+      }
+      itr = claims.erase( itr );
+      ++erased;
+   }
+   drops.erase( drop );
+}
+
+// first 64 bits of the current transaction id, binds vouchers to the opening of a channel
+static uint64_t transaction_nonce()
+{
+   vector<char> trx( eosio::transaction_size() );
+   eosio::read_transaction( trx.data(), trx.size() );
+   const auto id = eosio::sha256( trx.data(), trx.size() ).extract_as_byte_array();
+   uint64_t nonce = 0;
+   for( size_t i = 0; i < sizeof(nonce); ++i ) {
+      nonce = (nonce << 8) | id[i];
+   }
+   return nonce;
+}
+
+void token::chanopen( name from, name to, name id, asset quantity, public_key key, uint32_t delay )
+{
+   require_auth( from );
+   eosio::check( from != to, "cannot open channel to self" );
+   eosio::check( is_account( to ), "to account does not exist");
+
+   eosio::check( quantity.is_valid(), "invalid quantity" );
+   eosio::check( quantity.amount > 0, "must lock positive quantity" );
+   check_symbol( quantity.symbol );
+   eosio::check( delay > 0, "delay must be > 0" );
+   eosio::check( delay <= config::safe_max_delay, config::delay_error );
+
+   channels chans( _self, from.value );
+   eosio::check( chans.find( id.value ) == chans.end(), "channel with the same id already exists" );
+   // the deposit is held by the contract account, so it stays a part of the balances
+   sub_balance( from, quantity );
+   add_balance( _self, quantity, from );
+   chans.emplace( from, [&]( auto& c ) {
+      c.id = id;
+      c.to = to;
+      c.deposit = quantity;
+      c.settled = asset{0, quantity.symbol};
+      c.key = key;
+      c.delay = delay;
+      c.nonce = transaction_nonce();
+   });
+}
+
+void token::chansettle( name from, name id, asset amount, signature sig )
+{
+   channels chans( _self, from.value );
+   const auto& chan = chans.get( id.value, "channel not found" );
+   require_auth( chan.to );
+
+   eosio::check( amount.symbol == chan.deposit.symbol, "symbol precision mismatch" );
+   check_symbol( amount.symbol );  // loads the stats in case the payee balance is created
+   eosio::check( amount.amount > chan.settled.amount, "amount is already settled" );
+   eosio::check( amount.amount <= chan.deposit.amount, "amount exceeds channel deposit" );
+
+   const auto voucher = eosio::pack( std::make_tuple( _self, from, chan.to, id, chan.nonce, amount ) );
+   eosio::assert_recover_key( eosio::sha256( voucher.data(), voucher.size() ), sig, chan.key );
+
+   sub_balance( _self, amount - chan.settled );
+   add_payment( chan.to, amount - chan.settled, chan.to );
+   chans.modify( chan, same_payer, [&]( auto& c ) {
+      c.settled = amount;
+   });
+}
+
+void token::chanclose( name from, name id )
+{
+   channels chans( _self, from.value );
+   const auto& chan = chans.get( id.value, "channel not found" );
+   if( !has_auth( chan.to ) ) {
+      require_auth( from );
+      if( chan.closes == time_point_sec() ) {
+         // the payee has the channel delay to settle the latest voucher
+         chans.modify( chan, same_payer, [&]( auto& c ) {
+            c.closes = eosio::current_time_point() + eosio::seconds( c.delay );
+         });
+         return;
+      }
+      eosio::check( chan.closes <= eosio::current_time_point(), "channel close is time locked" );
+   }
+
+   if( chan.settled < chan.deposit ) {
+      check_symbol( chan.deposit.symbol );  // loads the stats in case the payer balance is created
+      sub_balance( _self, chan.deposit - chan.settled );
+      add_balance( from, chan.deposit - chan.settled, from );
+   }
+   chans.erase( chan );
 }
 
 void token::claim( name owner, asset quantity )
@@ -252,12 +923,11 @@ void token::claim( name owner, asset quantity )
    eosio::check( quantity.is_valid(), "invalid quantity" );
    eosio::check( quantity.amount > 0, "must transfer positive quantity" );
 
-   accounts owner_acnts( _self, owner.value );
-   auto account = owner_acnts.find( quantity.symbol.code().raw() );
-   eosio::check( account != owner_acnts.end(), "not found object account" );
+   const auto* account = find_account( owner, quantity.symbol.code() );
+   eosio::check( account != nullptr, "not found object account" );
    eosio::check( quantity.symbol == account->payments.symbol, "symbol precision mismatch" );
    eosio::check( account->payments >= quantity, "insufficient funds" );
-   owner_acnts.modify( account, owner, [&]( auto& a ) {
+   modify_account( owner, *account, owner, [&]( auto& a ) {
        a.balance += quantity;
        a.payments -= quantity;
 
@@ -265,43 +935,174 @@ void token::claim( name owner, asset quantity )
    });
 }
 
-void token::bulktransfer(name from, vector<recipient> recipients)
+// Recipients of one token inside a bulk transfer
+struct bulk_group {
+    asset total;
+    vector<credit_t> credits;
+};
+
+void token::do_bulk_transfer(name from, recipients_reader recipients, bool payment, bool single_symbol)
 {
     require_recipient(from);
-    eosio::check(recipients.size(), "recipients must not be empty");
-
-    symbol temp_symbol = recipients.at(0).quantity.symbol;
-    std::set<name> require_recipients;
-    for (auto recipient_obj : recipients) {
-        eosio::check(temp_symbol == recipient_obj.quantity.symbol, "transfer of different tokens is prohibited");
-        do_transfer(from, recipient_obj.to, recipient_obj.quantity, recipient_obj.memo);
+    recipient_view recipient_obj;
+    eosio::check(recipients.next(recipient_obj), "recipients must not be empty");
+    require_auth(from);
+
+    // Validate the whole batch first, then debit the sender once per token for the group
+    // total and credit every distinct recipient once per token with the merged amount.
+    const auto first_sym = recipient_obj.quantity.symbol;
+    vector<bulk_group> groups;      // few tokens per batch, so the linear search is cheaper than a map
+    vector<name> require_recipients;
+    require_recipients.reserve(recipients.size());
+    do {
+        const auto& quantity = recipient_obj.quantity;
+        if (single_symbol)
+            eosio::check(first_sym == quantity.symbol, payment ?
+                "payment of different tokens is prohibited" : "transfer of different tokens is prohibited");
+        if (!payment)
+            eosio::check(from != recipient_obj.to, "cannot transfer to self");
+        eosio::check(quantity.is_valid(), "invalid quantity");
+        eosio::check(quantity.amount > 0, "must transfer positive quantity");
+        eosio::check(recipient_obj.memo.size() <= config::max_memo_size, config::memo_error);
+
+        const auto sym = quantity.symbol.code();
+        auto group = std::find_if(groups.begin(), groups.end(), [&](const auto& g) { return g.total.symbol.code() == sym; });
+        if (group == groups.end()) {
+            const auto& st = get_stat(sym);
+            group = groups.insert(groups.end(), bulk_group{asset{0, st.supply.symbol}});
+        }
+        eosio::check(quantity.symbol == group->total.symbol, "symbol precision mismatch");
+        group->total += quantity;  // asset addition checks overflow
+        group->credits.emplace_back(recipient_obj.to, quantity);
+        require_recipients.push_back(recipient_obj.to);
+    } while (recipients.next(recipient_obj));
+
+    unique_in_order(require_recipients);
+    for (auto to : require_recipients) {
+        eosio::check(is_account(to), "to account does not exist");
+        if (!payment)
+            require_recipient(to);
+    }
 
-        auto result = require_recipients.insert(recipient_obj.to);
-        if (result.second)
-            require_recipient(recipient_obj.to);
+    for (auto& group : groups) {
+        merge_credits(group.credits);
+        sub_balance(from, group.total);
+        for (const auto& credit : group.credits) {
+            auto payer = has_auth(credit.first) ? credit.first : from;
+            if (payment)
+                add_payment(credit.first, credit.second, payer);
+            else
+                add_balance(credit.first, credit.second, payer);
+        }
     }
 }
 
-void token::bulkpayment(name from, vector<recipient> recipients)
+// bulk actions decode their arguments from the action data themselves, so memos are not copied
+void token::do_bulk_transfer(bool payment, bool single_symbol)
 {
-    require_recipient(from);
-    eosio::check(recipients.size(), "recipients must not be empty");
+    name from;
+    _ds >> from;
+    do_bulk_transfer(from, recipients_reader(_ds), payment, single_symbol);
+}
+
+void token::bulktransfer(ignore<name>, ignore<vector<recipient>>)
+{
+    do_bulk_transfer(false, true);
+}
+
+void token::bulkpayment(ignore<name>, ignore<vector<recipient>>)
+{
+    do_bulk_transfer(true, true);
+}
+
+void token::bulkmulti(ignore<name>, ignore<vector<recipient>>)
+{
+    do_bulk_transfer(false, false);
+}
+
+void token::bulkmultipay(ignore<name>, ignore<vector<recipient>>)
+{
+    do_bulk_transfer(true, false);
+}
+
+// Change of a balance inside a settlement
+struct net_position {
+    std::pair<uint64_t, uint64_t> key;  // owner, symbol code
+    asset net;
+    name  payer;    // ram payer if the balance is created, empty if no authorized account
+};
+
+void token::settle(vector<transfer_leg> legs)
+{
+    eosio::check(legs.size(), "legs must not be empty");
+
+    vector<net_position> positions;
+    vector<name> participants;
+    positions.reserve(legs.size() * 2);
+    participants.reserve(legs.size() * 2);
+    for (const auto& leg : legs) {
+        const auto& quantity = leg.quantity;
+        eosio::check(leg.from != leg.to, "cannot transfer to self");
+        eosio::check(quantity.is_valid(), "invalid quantity");
+        eosio::check(quantity.amount > 0, "must transfer positive quantity");
+        const auto sym = quantity.symbol.code();
+        eosio::check(quantity.symbol == get_stat(sym).supply.symbol, "symbol precision mismatch");
+
+        positions.push_back(net_position{{leg.from.value, sym.raw()}, -quantity, name()});
+        const name payer = has_auth(leg.to) ? leg.to : has_auth(leg.from) ? leg.from : name();
+        positions.push_back(net_position{{leg.to.value, sym.raw()}, quantity, payer});
+        participants.push_back(leg.from);
+        participants.push_back(leg.to);
+    }
 
-    symbol temp_symbol = recipients.at(0).quantity.symbol;
-    for (auto recipient_obj : recipients) {
-        eosio::check(temp_symbol == recipient_obj.quantity.symbol, "payment of different tokens is prohibited");
-        do_transfer(from, recipient_obj.to, recipient_obj.quantity, recipient_obj.memo, true);
+    unique_in_order(participants);
+    for (auto acc : participants) {
+        eosio::check(is_account(acc), "account does not exist");
+        require_recipient(acc);
+    }
+
+    // merge changes of every balance; a new balance is paid by the first authorized payer of the transfers to it
+    std::stable_sort(positions.begin(), positions.end(), [](const auto& l, const auto& r) { return l.key < r.key; });
+    auto last = positions.begin();
+    for (auto itr = positions.begin(); itr != positions.end(); ++itr) {
+        if (itr == last) continue;
+        if (itr->key == last->key) {
+            last->net += itr->net;
+            if (last->payer == name()) {
+                last->payer = itr->payer;
+            }
+        } else {
+            *++last = *itr;
+        }
+    }
+    positions.erase(++last, positions.end());
+
+    for (const auto& pos : positions) {
+        if (pos.net.amount < 0) {
+            const name owner{pos.key.first};
+            require_auth(owner);
+            sub_balance(owner, -pos.net);
+        }
+    }
+    for (const auto& pos : positions) {
+        if (pos.net.amount > 0) {
+            const name owner{pos.key.first};
+            eosio::check(pos.payer != name() || find_account(owner, pos.net.symbol.code()) != nullptr,
+                "no authorized ram payer for new balance");
+            add_balance(owner, pos.net, pos.payer);
+        }
     }
 }
 
 ////////////////////////////////////////////////////////////////
 // safe related actions
+#ifndef CYBER_TOKEN_LITE
 using std::optional;
 
-void check_safe_params(name owner, optional<uint32_t> delay, optional<name> trusted) {
+void token::check_safe_params(name owner, optional<uint32_t> delay, optional<name> trusted) {
    if (delay) {
       check(*delay > 0, "delay must be > 0");
-      check(*delay <= config::safe_max_delay, "delay must be <= " + std::to_string(config::safe_max_delay));
+      check(*delay <= config::safe_max_delay, config::delay_error);
    }
    if (trusted && *trusted != name()) {
       check(owner != *trusted, "trusted and owner must be different accounts");
@@ -315,12 +1116,11 @@ void token::enablesafe(name owner, asset unlock, uint32_t delay, name trusted) {
    check(unlock.amount >= 0, "unlock amount must be >= 0");
    check_safe_params(owner, delay, trusted);
    if (unlock.symbol != symbol{}) {
-      validate_symbol(_self, unlock);
+      check_symbol(unlock.symbol);
    }
 
-   accounts tbl(_self, owner.value);
    const auto scode = unlock.symbol.code();
-   const auto& acc = tbl.get(scode.raw(), "no token account object found");
+   const auto& acc = get_account(owner, scode, "no token account object found");
    check(!acc.has_safe(), "safe already enabled");
 
    // Do not allow to have delayed changes when enable the safe, they came from the previously enabled safe
@@ -328,20 +1128,20 @@ void token::enablesafe(name owner, asset unlock, uint32_t delay, name trusted) {
    safemod_tbl mods(_self, owner.value);
    auto idx = mods.get_index<"bysymbolcode"_n>();
    auto itr = idx.lower_bound(scode);
+   count(&access_counters::safemod_reads);
    check(itr == idx.end() || itr->sym_code != scode, "can't enable safe with existing delayed mods");
 
-   tbl.modify(acc, owner, [&](auto& a) {
+   modify_account(owner, acc, owner, [&](auto& a) {
       a.create_safe(safe_t{unlock.amount, delay, trusted});
    });
 }
 
-template<typename Tbl, typename S>
-void instant_safe_change(Tbl& tbl, S& acc,
-   name owner, int64_t unlock, optional<uint32_t> delay, optional<name> trusted, bool ensure_change
+void token::instant_safe_change(name owner, const account& acc,
+   int64_t unlock, optional<uint32_t> delay, optional<name> trusted, bool ensure_change
 ) {
    if (delay && *delay == 0) {
       check(!unlock && !trusted, "SYS: incorrect disabling safe mod");
-      tbl.modify(acc, owner, [](auto& a){
+      modify_account(owner, acc, owner, [](auto& a){
          a.remove_safe();
       });
    } else {
@@ -361,12 +1161,28 @@ void instant_safe_change(Tbl& tbl, S& acc,
             changed = true;
       }
       check(changed, "change has no effect and can be cancelled");
-      tbl.modify(acc, owner, [&](auto& a) {
+      modify_account(owner, acc, owner, [&](auto& a) {
          a.modify_safe(safe);
       });
    }
 }
 
+// checks if instant_safe_change() would succeed for the delayed change
+bool token::safe_change_applies(const account* acc, const safemod& mod) {
+   if (!acc || !acc->has_safe()) {
+      return false;
+   }
+   if (mod.delay && *mod.delay == 0) {
+      return true;
+   }
+   const auto safe = acc->get_safe();
+   // safe.unlocked is within [0, max_amount], so the bounds are computed without overflow
+   if (mod.unlock > 0 ? mod.unlock > asset::max_amount - safe.unlocked : mod.unlock < -safe.unlocked) {
+      return false;
+   }
+   return mod.unlock || (mod.delay && *mod.delay != safe.delay) || (mod.trusted && *mod.trusted != safe.trusted);
+}
+
 // helper for actions which do not change `unlocked` and have incomplete asset symbol
 void token::delay_safe_change(
    name owner, symbol_code scode, name mod_id, optional<uint32_t> delay, optional<name> trusted,
@@ -384,12 +1200,11 @@ void token::delay_safe_change(
       check_safe_params(owner, delay, trusted);
    }
    if (check_sym) {
-      validate_symbol(_self, unlock);
+      check_symbol(unlock.symbol);
    }
 
    const auto scode = unlock.symbol.code();
-   accounts tbl(_self, owner.value);
-   const auto& acc = tbl.get(scode.raw(), "no token account object found");
+   const auto& acc = get_account(owner, scode, "no token account object found");
    auto safe = acc.get_safe();
 
    const bool have_id = mod_id != name();
@@ -398,11 +1213,13 @@ void token::delay_safe_change(
       check(!have_id, "mod_id must be empty for trusted action");
       check(!delay || *delay != safe.delay, "can't set same delay");
       check(!trusted || *trusted != trusted_acc, "can't set same trusted");
-      instant_safe_change(tbl, acc, owner, unlock.amount, delay, trusted, false);
+      instant_safe_change(owner, acc, unlock.amount, delay, trusted, false);
    } else {
       check(have_id, "mod_id must not be empty");
       safemod_tbl mods(_self, owner.value);
       check(mods.find(mod_id.value) == mods.end(), "safe mod with the same id is already exists");
+      count(&access_counters::safemod_reads);
+      count(&access_counters::safemod_writes);
       mods.emplace(owner, [&](auto& d) {
          d.id = mod_id;
          d.sym_code = scode;
@@ -428,17 +1245,16 @@ void token::unlocksafe(name owner, asset unlock, name mod_id) {
 void token::locksafe(name owner, asset lock) {
    require_auth(owner);
    check(lock.amount >= 0, "lock amount must be >= 0");
-   validate_symbol(_self, lock); // checked within "<= unlocked", but have confusing message, so check here
+   check_symbol(lock.symbol); // checked within "<= unlocked", but have confusing message, so check here
 
    const auto scode = lock.symbol.code();
-   accounts tbl(_self, owner.value);
-   const auto& acc = tbl.get(scode.raw(), "no token account object found");
+   const auto& acc = get_account(owner, scode, "no token account object found");
    auto safe = acc.get_safe();
    check(safe.unlocked > 0, "nothing to lock");
    check(safe.unlocked >= lock.amount, "lock must be <= unlocked");
 
    bool lock_all = lock.amount == 0;
-   tbl.modify(acc, owner, [&](auto& a) {
+   modify_account(owner, acc, owner, [&](auto& a) {
       safe.unlocked -= lock_all ? safe.unlocked : lock.amount;
       a.modify_safe(safe);
    });
@@ -456,37 +1272,119 @@ void token::applysafemod(name owner, name mod_id) {
    require_auth(owner);
    safemod_tbl mods(_self, owner.value);
    const auto& mod = mods.get(mod_id.value, "safe mod not found");
+   count(&access_counters::safemod_reads);
 
-   accounts tbl(_self, owner.value);
-   const auto& acc = tbl.get(mod.sym_code.raw(), "no token account object found");
+   const auto& acc = get_account(owner, mod.sym_code, "no token account object found");
    const auto& safe = acc.get_safe();
 
    bool trusted_apply = safe.trusted != name() && has_auth(safe.trusted);
    if (!trusted_apply) {
       check(mod.date <= eosio::current_time_point(), "safe change is time locked");
-      check(!is_locked(_self, owner), "safe locked globally");
+      check_unlocked(owner, acc, "safe locked globally");
    }
-   instant_safe_change(tbl, acc, owner, mod.unlock, mod.delay, mod.trusted, true);
+   instant_safe_change(owner, acc, mod.unlock, mod.delay, mod.trusted, true);
+   count(&access_counters::safemod_writes);
    mods.erase(mod);
 }
 
+void token::applyready(name owner, symbol_code sym_code) {
+   require_auth(owner);
+   check(!is_locked(owner), "safe locked globally");
+
+   safemod_tbl mods(_self, owner.value);
+   const time_point_sec now = eosio::current_time_point();
+   vector<safemod::date_key_t> ready;
+   if (sym_code == symbol_code()) {
+      auto idx = mods.get_index<"bydate"_n>();
+      for (auto itr = idx.begin(); itr != idx.end() && itr->date <= now; ++itr) {
+         count(&access_counters::safemod_reads);
+         ready.push_back(itr->by_date());
+      }
+   } else {
+      // only the range of the symbol is read, then its ready mods are ordered by ready time
+      auto idx = mods.get_index<"bysymbolcode"_n>();
+      for (auto itr = idx.lower_bound(sym_code); itr != idx.end() && itr->sym_code == sym_code; ++itr) {
+         count(&access_counters::safemod_reads);
+         if (itr->date <= now) {
+            ready.push_back(itr->by_date());
+         }
+      }
+      std::sort(ready.begin(), ready.end());
+   }
+   check(!ready.empty(), "no ready safe mods");
+
+   // mods which can't be applied (e.g. queued after disabling the safe) are kept for cancelsafemod
+   bool applied = false;
+   for (const auto& key : ready) {
+      const auto& mod = mods.get(std::get<1>(key).value);
+      const auto* acc = find_account(owner, mod.sym_code);
+      if (!safe_change_applies(acc, mod)) {
+         continue;
+      }
+      instant_safe_change(owner, *acc, mod.unlock, mod.delay, mod.trusted, true);
+      count(&access_counters::safemod_writes);
+      mods.erase(mod);
+      applied = true;
+   }
+   check(applied, "no applicable ready safe mods");
+}
+
 void token::cancelsafemod(name owner, name mod_id) {
    require_auth(owner);
    safemod_tbl mods(_self, owner.value);
    const auto& mod = mods.get(mod_id.value, "safe mod not found");
+   count(&access_counters::safemod_reads);
+   count(&access_counters::safemod_writes);
    mods.erase(mod);
 }
 
 void token::globallock(name owner, uint32_t period) {
    require_auth(owner);
    check(period > 0, "period must be > 0");
-   check(period <= config::safe_max_delay, "period must be <= " + std::to_string(config::safe_max_delay));
+   check(period <= config::safe_max_delay, config::period_error);
 
    time_point_sec unlocks{eosio::current_time_point() + eosio::seconds(period)};
-   lock_singleton lock(_self, owner.value);
-   check(unlocks > lock.get_or_default().unlocks, "new unlock time must be greater than current");
+   check(unlocks > get_lock(owner).unlocks, "new unlock time must be greater than current");
+
+   set_lock(owner, {unlocks}, owner);
+   for_each_account(owner, [&](const auto& acc) {
+      if (!acc.may_be_locked()) {
+         modify_account(owner, acc, owner, [](auto& a) {
+            a.set_flag(account::lock_flag, true);
+         });
+      }
+   });
+}
 
-   lock.set({unlocks}, owner);
+void token::deletelock(name owner) {
+   check(lock_row(owner).alive, "global lock not found");
+   check(!is_locked(owner), "global lock is still active");
+   erase_lock(owner);
+   for_each_account(owner, [&](const auto& acc) {
+      if (acc.has_flag(account::lock_flag)) {
+         modify_account(owner, acc, same_payer, [](auto& a) {
+            a.set_flag(account::lock_flag, false);
+            a.set_flag(account::lock_synced, true);
+         });
+      }
+   });
+}
+
+void token::synclock(name owner) {
+   const name payer = has_auth(owner) ? owner : _self;
+   if (!has_auth(payer)) {
+      require_auth(owner);    // fails with the same message as before
+   }
+   const bool has_lock = lock_row(owner).alive;
+   for_each_account(owner, [&](const auto& acc) {
+      if (acc.has_flag(account::lock_flag) != has_lock || !acc.has_flag(account::lock_synced)) {
+         modify_account(owner, acc, payer, [&](auto& a) {
+            a.set_flag(account::lock_flag, has_lock);
+            a.set_flag(account::lock_synced, true);
+         });
+      }
+   });
 }
+#endif // CYBER_TOKEN_LITE
 
 } /// namespace eosio